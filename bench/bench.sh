@@ -0,0 +1,21 @@
+#!/bin/bash
+# Compare startup of original and patched executables
+make -s || exit 1
+make -s -C .. || exit 1
+
+PROG=${PROG:=../postlinker}
+RUNS=${RUNS:=200}
+REL=${REL:=../tests/rel_syscall.o}
+
+printf "%-28s %10s %10s %8s %8s %6s %8s %6s\n" binary "mean[us]" \
+	"min[us]" minflt majflt vmas "rss[kB]" failed
+for exe in ../tests/exec_syscall ../tests/exec_noop ../tests/exec_static \
+	exec_large exec_large_static; do
+	patched=patched_$(basename ${exe})
+	if ! out=$(${PROG} ${exe} ${REL} ${patched} 2>&1); then
+		echo "Failed to patch ${exe}: ${out}" >&2
+		continue
+	fi
+	./bench_run ${RUNS} ${exe}
+	./bench_run ${RUNS} ./${patched}
+done
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Run <binary> <runs> times and report exec-to-exit latency,
+ * page faults, mapped VMAs and RSS of the process */
+
+static void child(char **argv, int traced) {
+	int null = open("/dev/null", O_WRONLY);
+	if (null >= 0) {
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+	}
+	if (traced)
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+	execv(argv[0], argv);
+	_exit(127);
+}
+
+static long count_lines(const char *path) {
+	FILE *f = fopen(path, "r");
+	long lines = 0;
+	int c;
+	if (!f)
+		return -1;
+	while ((c = fgetc(f)) != EOF)
+		if (c == '\n')
+			++lines;
+	fclose(f);
+	return lines;
+}
+
+static long status_field(const char *path, const char *field) {
+	FILE *f = fopen(path, "r");
+	char line[256];
+	long value = -1;
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof line, f))
+		if (!strncmp(line, field, strlen(field)))
+			value = atol(line + strlen(field));
+	fclose(f);
+	return value;
+}
+
+/* Stop the process right before it exits
+ * to read its memory layout from /proc */
+static int layout(char **argv, long *vmas, long *rss) {
+	char path[64];
+	int status;
+	pid_t pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0)
+		child(argv, 1);
+	if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+		return -1;
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACEEXIT);
+	ptrace(PTRACE_CONT, pid, NULL, NULL);
+	while (waitpid(pid, &status, 0) == pid && WIFSTOPPED(status)) {
+		if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))) {
+			snprintf(path, sizeof path, "/proc/%d/maps", pid);
+			*vmas = count_lines(path);
+			snprintf(path, sizeof path, "/proc/%d/status", pid);
+			*rss = status_field(path, "VmRSS:");
+			ptrace(PTRACE_CONT, pid, NULL, NULL);
+		} else {
+			ptrace(PTRACE_CONT, pid, NULL, WSTOPSIG(status));
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct timespec start, end;
+	struct rusage usage;
+	double total = 0, min = -1, us;
+	long minflt = 0, majflt = 0, vmas = -1, rss = -1;
+	int runs, status, failed = 0;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: ./bench_run <RUNS> <BINARY> [ARGS...]\n");
+		return 1;
+	}
+	runs = atoi(argv[1]);
+	if (runs <= 0) {
+		fprintf(stderr, "ERROR: invalid number of runs\n");
+		return 1;
+	}
+
+	for (int i = 0; i < runs; ++i) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0)
+			child(argv + 2, 0);
+		if (wait4(pid, &status, 0, &usage) < 0) {
+			perror("wait4");
+			return 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			++failed;
+
+		us = (end.tv_sec - start.tv_sec) * 1e6 +
+		     (end.tv_nsec - start.tv_nsec) / 1e3;
+		total += us;
+		if (min < 0 || us < min)
+			min = us;
+		minflt += usage.ru_minflt;
+		majflt += usage.ru_majflt;
+	}
+
+	if (layout(argv + 2, &vmas, &rss) < 0)
+		fprintf(stderr, "WARNING: could not read layout of %s\n", argv[2]);
+
+	printf("%-28s %10.1f %10.1f %8.1f %8.2f %6ld %8ld %6d\n", argv[2],
+	       total / runs, min, (double)minflt / runs, (double)majflt / runs,
+	       vmas, rss, failed);
+	return failed != 0;
+}
@@ -0,0 +1,27 @@
+#!/bin/bash
+# Generate synthetic program with <FUNCS> functions
+# and <DATA_KB> kB of initialized data
+FUNCS=${1:-2000}
+DATA_KB=${2:-1024}
+
+echo '#include <stdio.h>'
+echo
+echo "volatile char data[$((DATA_KB * 1024))] = {1};"
+echo
+for ((i = 0; i < FUNCS; ++i)); do
+	echo "__attribute__((noinline)) int f$i(int x) { return x * $i + data[$i]; }"
+done
+echo
+echo 'int (*const funcs[])(int) = {'
+for ((i = 0; i < FUNCS; ++i)); do
+	echo "	f$i,"
+done
+echo '};'
+echo
+echo 'int main() {'
+echo '	int s = 0;'
+echo '	for (unsigned i = 0; i < sizeof funcs / sizeof *funcs; i += 64)'
+echo '		s += funcs[i](i);'
+echo '	printf("Main program [large] %d\n", s & 1);'
+echo '	return 0;'
+echo '}'
@@ -50,16 +50,166 @@ void makeSpaceForHeaders(Context &ctx, headerT &header,
   return;
 }
 
-/* Add new segment containg passed sections
- * with <segment_flags> permissions */
-void addNewSegment(Context &ctx, headerT &header, vector<segmentT> &segments,
-                   const vector<pair<int, sectionT>> &sections,
-                   vector<sectionT> &rel_sections,
-                   unordered_map<int, uint64_t> &offset_map,
-                   int segment_flags) {
+/* Split SHF_MERGE section content into entries:
+ * null terminated strings or <sh_entsize> sized constants.
+ * Returns false if the content does not split evenly */
+bool splitMergeEntries(const sectionT &s, const vector<char> &data,
+                       vector<pair<uint64_t, string>> &entries) {
+  uint64_t entsize = s.sh_entsize;
+  if (data.size() % entsize != 0) {
+    return false;
+  }
+  uint64_t start = 0;
+  for (uint64_t pos = 0; pos < data.size(); pos += entsize) {
+    bool end = true;
+    if (s.sh_flags & SHF_STRINGS) {
+      for (uint64_t i = 0; i < entsize; ++i) {
+        if (data[pos + i] != '\0') {
+          end = false;
+        }
+      }
+    }
+    if (end) {
+      entries.emplace_back(std::make_pair(
+          start, string(data.begin() + start, data.begin() + pos + entsize)));
+      start = pos + entsize;
+    }
+  }
+  return start == data.size();
+}
+
+/* Deduplicate entries of SHF_MERGE sections of the same kind
+ * and replace them with a single merged section.
+ * Strings that are suffixes of other strings are tail-merged */
+void mergeSections(FILE *rel, vector<pair<int, sectionT>> &sections,
+                   vector<MergedSection> &merged) {
+  vector<pair<int, sectionT>> kept;
+  vector<vector<pair<uint64_t, string>>> group_entries;
+  vector<vector<pair<int, uint64_t>>> group_members;
+  auto first_group = merged.size();
+
+  for (auto &p : sections) {
+    auto &s = p.second;
+    vector<pair<uint64_t, string>> entries;
+    if ((s.sh_flags & SHF_MERGE) && s.sh_type == SHT_PROGBITS &&
+        s.sh_entsize != 0) {
+      vector<char> data(s.sh_size);
+      HANDLE_ERROR(fseek(rel, s.sh_offset, SEEK_SET), "mergeSections: fseek");
+      HANDLE_ERROR(fread((char *)data.data(), s.sh_size, 1, rel),
+                   "mergeSections: fread");
+      if (!splitMergeEntries(s, data, entries)) {
+        kept.emplace_back(p);
+        continue;
+      }
+    } else {
+      kept.emplace_back(p);
+      continue;
+    }
+
+    auto g = first_group;
+    for (; g < merged.size(); ++g) {
+      auto &h = merged[g].header;
+      if ((h.sh_flags & SHF_STRINGS) == (s.sh_flags & SHF_STRINGS) &&
+          h.sh_entsize == s.sh_entsize &&
+          h.sh_addralign == s.sh_addralign) {
+        break;
+      }
+    }
+    if (g == merged.size()) {
+      MergedSection m;
+      m.index = p.first;
+      m.header = s;
+      merged.emplace_back(m);
+      group_entries.emplace_back();
+      group_members.emplace_back();
+      kept.emplace_back(p);
+    }
+    auto &ge = group_entries[g - first_group];
+    ge.insert(ge.end(), entries.begin(), entries.end());
+    group_members[g - first_group].emplace_back(
+        std::make_pair(p.first, entries.size()));
+    merged[g].pieces[p.first];
+  }
+
+  for (auto g = first_group; g < merged.size(); ++g) {
+    auto &m = merged[g];
+    auto &entries = group_entries[g - first_group];
+    uint64_t align = std::max(m.header.sh_addralign, uint64_t(1));
+    uint64_t step = std::max(align, m.header.sh_entsize);
+
+    // Unique entries in order of the first occurrence
+    vector<string> uniques;
+    unordered_map<string, uint64_t> out_offs;
+    for (auto &e : entries) {
+      if (out_offs.emplace(e.second, 0).second) {
+        uniques.emplace_back(e.second);
+      }
+    }
+
+    /* Sort strings by their reversed content, so every string
+     * directly follows the ones it is a suffix of */
+    unordered_map<string, string> tails;
+    if (m.header.sh_flags & SHF_STRINGS) {
+      vector<string> order = uniques;
+      std::sort(order.begin(), order.end(),
+                [](const string &a, const string &b) {
+                  return std::lexicographical_compare(a.rbegin(), a.rend(),
+                                                      b.rbegin(), b.rend());
+                });
+      const string *host = nullptr;
+      for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        if (host && host->size() > it->size() &&
+            (host->size() - it->size()) % step == 0 &&
+            std::equal(it->rbegin(), it->rend(), host->rbegin())) {
+          tails[*it] = *host;
+        } else {
+          host = &*it;
+        }
+      }
+    }
+
+    for (auto &u : uniques) {
+      if (tails.count(u)) {
+        continue;
+      }
+      if (m.data.size() % align != 0) {
+        m.data.resize(m.data.size() + align - (m.data.size() % align));
+      }
+      out_offs[u] = m.data.size();
+      m.data.insert(m.data.end(), u.begin(), u.end());
+    }
+    for (auto &t : tails) {
+      out_offs[t.first] =
+          out_offs[t.second] + t.second.size() - t.first.size();
+    }
+
+    uint64_t i = 0;
+    for (auto &member : group_members[g - first_group]) {
+      auto &pieces = m.pieces[member.first];
+      for (auto end = i + member.second; i < end; ++i) {
+        pieces.push_back({entries[i].first, out_offs[entries[i].second]});
+      }
+    }
+    m.header.sh_size = m.data.size();
+    m.header.sh_addralign = align;
+  }
+
+  for (auto &p : kept) {
+    auto m = findMergedSection(merged, p.first);
+    if (m) {
+      p.second = m->header;
+    }
+  }
+  sections = kept;
+  return;
+}
+
+/* Place passed sections one after another starting at the
+ * page following <ctx.file_end>, return their total size */
+int layoutSections(Context &ctx, const vector<pair<int, sectionT>> &sections,
+                   unordered_map<int, uint64_t> &offset_map) {
+  int size = 0;
   if (sections.size()) {
-    segmentT p;
-    int size = 0;
     int new_off = ctx.file_end;
     if (new_off % constants::kPageSize != 0) {
       new_off += constants::kPageSize - (new_off % constants::kPageSize);
@@ -72,104 +222,154 @@ void addNewSegment(Context &ctx, headerT &header, vector<segmentT> &segments,
       offset_map[s.first] = new_off + size;
       size += s.second.sh_size;
     }
-    if (size != 0) {
-      p.p_type = PT_LOAD;
-      p.p_flags = segment_flags;
-      p.p_offset = new_off;
-      p.p_vaddr = new_off + ctx.base_address;
-      p.p_paddr = new_off + ctx.base_address;
-      p.p_filesz = size;
-      p.p_memsz = size;
-      p.p_align = constants::kPageSize;
-      segments.emplace_back(p);
+    ctx.file_end += size;
+  }
+  return size;
+}
 
-      header.e_phnum++;
-      ctx.file_end += size;
-    }
+/* Add new segment containg passed sections
+ * with <segment_flags> permissions */
+void addNewSegment(Context &ctx, headerT &header, vector<segmentT> &segments,
+                   const vector<pair<int, sectionT>> &sections,
+                   unordered_map<int, uint64_t> &offset_map,
+                   int segment_flags) {
+  int size = layoutSections(ctx, sections, offset_map);
+  if (size != 0) {
+    segmentT p;
+    int new_off = ctx.file_end - size;
+    p.p_type = PT_LOAD;
+    p.p_flags = segment_flags;
+    p.p_offset = new_off;
+    p.p_vaddr = new_off + ctx.base_address;
+    p.p_paddr = new_off + ctx.base_address;
+    p.p_filesz = size;
+    p.p_memsz = size;
+    p.p_align = constants::kPageSize;
+    segments.emplace_back(p);
+
+    header.e_phnum++;
   }
   return;
 }
 
-/* Handle single relocation
+/* Plan single relocation
  * - calculate symbol value
- * - calculate adress or difference
- * - write it to the output file */
-void handleRelocation(Context &ctx, FILE *output, pair<string, relaT> &r,
-                      const vector<symT> &rel_syms,
-                      const vector<symT> &exec_syms,
-                      const vector<char> &rel_strings,
-                      const vector<char> &exec_strings,
-                      const vector<char> &rel_section_names,
-                      const indexSecVecT &chosen_sections,
-                      unordered_map<int, uint64_t> &offset_map) {
-  int32_t symbol_address;
+ * - resolve PC relative references inside the object
+ *   and write them to the section content
+ * - keep the rest as fixups applied against the exec */
+void planRelocation(LinkPlan &plan, pair<string, relaT> &r,
+                    const vector<symT> &rel_syms,
+                    const vector<char> &rel_strings,
+                    const vector<char> &rel_section_names,
+                    const vector<MergedSection> &merged,
+                    unordered_map<int, uint64_t> &offset_map) {
+  int64_t symbol_address;
   auto &symbol = rel_syms[ELF64_R_SYM(r.second.r_info)];
   auto sym_name = getName(symbol.st_name, rel_strings);
-  int section_offset;
+  auto addend = r.second.r_addend;
+  int target;
   if (correctSymbolType(ELF64_ST_TYPE(symbol.st_info))) {
-    if (symbol.st_shndx != SHN_UNDEF) {
-      section_offset = getSectionOffset(chosen_sections, symbol.st_shndx);
-      symbol_address = section_offset + symbol.st_value + ctx.base_address;
-    } else {
-      if (sym_name == "orig_start") {
-        symbol_address = ctx.orig_start;
-        section_offset = extractSectionInfo(chosen_sections, rel_section_names,
-                                            offset_map, ".text");
+    Fixup f;
+    f.section = findSectionIndex(plan.sections, rel_section_names, r.first);
+    f.offset = r.second.r_offset;
+    f.type = ELF64_R_TYPE(r.second.r_info);
+
+    auto merged_section = findMergedSection(merged, symbol.st_shndx);
+    if (merged_section) {
+      /* Section symbol + addend selects the merged entry,
+       * other symbols keep the addend relative to their entry */
+      auto &pieces = merged_section->pieces.at(symbol.st_shndx);
+      target = merged_section->index;
+      if (ELF64_ST_TYPE(symbol.st_info) == STT_SECTION) {
+        symbol_address = translateMergeOffset(pieces, symbol.st_value + addend);
+        addend = 0;
       } else {
-        bool found = false;
-        for (auto &exec_s : exec_syms) {
-          auto exec_name = getName(exec_s.st_name, exec_strings);
-          if (exec_name == sym_name) {
-            found = true;
-            symbol_address = exec_s.st_value;
-          }
-        }
-        if (!found)
-          LOG_ERROR("Could not find symbol " + sym_name);
+        symbol_address = translateMergeOffset(pieces, symbol.st_value);
       }
+    } else if (symbol.st_shndx != SHN_UNDEF) {
+      target = symbol.st_shndx;
+      symbol_address = symbol.st_value;
+    } else {
+      f.target = -1;
+      f.addend = addend;
+      f.symbol = sym_name;
+      plan.fixups.emplace_back(f);
+      return;
+    }
+    if (!offset_map.count(target)) {
+      LOG_ERROR("Could not find section with id: " + std::to_string(target));
     }
+    symbol_address += offset_map[target];
 
-    int32_t rel_section_offset = extractSectionInfo(
-        chosen_sections, rel_section_names, offset_map, r.first);
-    int32_t instr_address =
-        rel_section_offset + r.second.r_offset + ctx.base_address;
-    auto addend = r.second.r_addend;
-    uint64_t r_type = ELF64_R_TYPE(r.second.r_info);
+    if (isPCReference(f.type)) {
+      int32_t address =
+          symbol_address + addend - (offset_map[f.section] + f.offset);
+      auto &content = plan.contents[f.section];
+      std::copy((char *)&address, (char *)&address + sizeof(int32_t),
+                content.begin() + f.offset);
+    } else if (isAbsReference32(f.type) || isAbsReference64(f.type)) {
+      f.target = target;
+      f.addend = symbol_address - offset_map[target] + addend;
+      plan.fixups.emplace_back(f);
+    }
+  }
+  return;
+}
 
-    HANDLE_ERROR(fseek(output, instr_address - ctx.base_address, SEEK_SET),
-                 "handleRelocation: fseek 1");
-    if (isAbsReference32(r_type)) {
-      int32_t address = symbol_address + addend;
-      HANDLE_ERROR(fwrite(&address, 1, sizeof(int32_t), output),
-                   "handleRelocation: fwrite 1");
-    } else if (isAbsReference64(r_type)) {
-      int64_t address = symbol_address + addend;
-      HANDLE_ERROR(fwrite(&address, 1, sizeof(int64_t), output),
-                   "handleRelocation: fwrite 2");
-    } else if (isPCReference(r_type)) {
-      int32_t address = symbol_address + addend - instr_address;
-      HANDLE_ERROR(fwrite(&address, 1, sizeof(int32_t), output),
-                   "handleRelocation: fwrite 3");
+/* Keep names of the chosen sections and the object's symbols
+ * that describe code and data, so they can be written to the output */
+void planSymbols(LinkPlan &plan, const vector<symT> &rel_syms,
+                 const vector<char> &rel_strings,
+                 const vector<char> &rel_section_names,
+                 const vector<MergedSection> &merged) {
+  for (auto &v : plan.sections) {
+    for (auto &p : v) {
+      plan.section_names[p.first] =
+          getName(p.second.sh_name, rel_section_names);
     }
   }
+
+  for (auto &s : rel_syms) {
+    auto type = ELF64_ST_TYPE(s.st_info);
+    auto name = getName(s.st_name, rel_strings);
+    if (name.empty() || s.st_shndx == SHN_UNDEF || s.st_shndx >= SHN_LORESERVE)
+      continue;
+    if (type != STT_FUNC && type != STT_OBJECT &&
+        !(type == STT_NOTYPE && ELF64_ST_BIND(s.st_info) != STB_LOCAL))
+      continue;
+
+    PlanSymbol sym;
+    auto merged_section = findMergedSection(merged, s.st_shndx);
+    if (merged_section) {
+      sym.section = merged_section->index;
+      sym.value = translateMergeOffset(merged_section->pieces.at(s.st_shndx),
+                                       s.st_value);
+    } else if (plan.contents.count(s.st_shndx)) {
+      sym.section = s.st_shndx;
+      sym.value = s.st_value;
+    } else {
+      continue;
+    }
+    sym.info = s.st_info;
+    sym.other = s.st_other;
+    sym.size = s.st_size;
+    sym.name = name;
+    plan.symbols.emplace_back(sym);
+  }
   return;
 }
 
-/* Calculate and write relocations
+/* Calculate relocations of the relocatable file
  * Read needed strings and symbol tables
  * in the beggining */
-void applyRelocations(Context &ctx, FILE *rel, FILE *exec, FILE *output,
-                      headerT &output_header, const headerT &rel_header,
-                      const headerT &exec_header,
-                      const vector<sectionT> &exec_sections,
-                      const vector<sectionT> &rel_sections,
-                      const vector<sectionT> &output_sections,
-                      const indexSecVecT &chosen_sections,
-                      unordered_map<int, uint64_t> &offset_map) {
-  vector<relT> rels;
+void planRelocations(FILE *rel, const headerT &rel_header,
+                     const vector<sectionT> &rel_sections,
+                     const vector<MergedSection> &merged,
+                     unordered_map<int, uint64_t> &offset_map,
+                     LinkPlan &plan) {
   vector<pair<string, relaT>> relas;
-  vector<symT> rel_syms, exec_syms;
-  vector<char> rel_strings, rel_section_names, exec_strings;
+  vector<symT> rel_syms;
+  vector<char> rel_strings, rel_section_names;
 
   readStrings(rel, rel_sections[rel_header.e_shstrndx], rel_section_names);
 
@@ -185,36 +385,130 @@ void applyRelocations(Context &ctx, FILE *rel, FILE *exec, FILE *output,
     ++section_id;
   }
 
-  section_id = 0;
-  for (auto &s : exec_sections) {
-    if (s.sh_type == SHT_STRTAB && section_id != exec_header.e_shstrndx) {
-      readStrings(exec, s, exec_strings);
-    } else if (s.sh_type == SHT_SYMTAB) {
-      readSectionEntries(exec, s, exec_syms);
-    }
-    ++section_id;
-  }
-
-  /* For each relocation, caculate address/offset
-   * and save it in the file */
+  /* For each relocation, caculate offset
+   * or save it for the exec */
   for (auto &r : relas) {
-    handleRelocation(ctx, output, r, rel_syms, exec_syms, rel_strings,
-                     exec_strings, rel_section_names, chosen_sections,
-                     offset_map);
+    planRelocation(plan, r, rel_syms, rel_strings, rel_section_names, merged,
+                   offset_map);
   }
 
-  // Save header
+  planSymbols(plan, rel_syms, rel_strings, rel_section_names, merged);
+
+  plan.entry_section = -1;
+  plan.entry_value = 0;
   for (auto &s : rel_syms) {
-    if (getName(s.st_name, rel_strings) == "_start") {
-      auto section_offset = extractSectionInfo(
-          chosen_sections, rel_section_names, offset_map, ".text");
-      output_header.e_entry = s.st_value + section_offset + ctx.base_address;
+    if (getName(s.st_name, rel_strings) == "_start" &&
+        s.st_shndx != SHN_UNDEF) {
+      plan.entry_section = s.st_shndx;
+      plan.entry_value = s.st_value;
       break;
     }
   }
-  HANDLE_ERROR(fseek(output, 0, SEEK_SET), "applyRelocations: fseek 2");
+  return;
+}
+
+/* Read exec symbol tables: .symtab first, then .dynsym,
+ * so stripped execs can still be linked against.
+ * Every table uses its own sh_link string table, tables with
+ * .gnu.hash or .hash are looked up through it without an index */
+void readSymbolTables(FILE *exec, const vector<sectionT> &exec_sections,
+                      vector<SymbolTable> &tables) {
+  for (uint32_t type : {SHT_SYMTAB, SHT_DYNSYM}) {
+    for (size_t i = 0; i < exec_sections.size(); ++i) {
+      auto &s = exec_sections[i];
+      if (s.sh_type != type || s.sh_link >= exec_sections.size()) {
+        continue;
+      }
+      SymbolTable table;
+      table.hash_type = SHT_NULL;
+      readSectionEntries(exec, s, table.syms);
+      readStrings(exec, exec_sections[s.sh_link], table.strings);
+
+      for (auto &h : exec_sections) {
+        if (h.sh_link == i && (h.sh_type == SHT_GNU_HASH ||
+                               (h.sh_type == SHT_HASH &&
+                                table.hash_type != SHT_GNU_HASH))) {
+          table.hash_type = h.sh_type;
+          table.hash.clear();
+          readSectionEntries(exec, h, table.hash);
+        }
+      }
+
+      /* The first global definition wins, the exec's own symbols
+       * come before the ones appended by earlier postlinker runs.
+       * Locals are only used for names without a global */
+      if (table.hash_type == SHT_NULL) {
+        for (bool global : {true, false}) {
+          for (auto &sym : table.syms) {
+            if (definedSymbol(sym) &&
+                (ELF64_ST_BIND(sym.st_info) != STB_LOCAL) == global) {
+              table.index.emplace(getName(sym.st_name, table.strings),
+                                  sym.st_value);
+            }
+          }
+        }
+      }
+      tables.emplace_back(table);
+    }
+  }
+  return;
+}
+
+/* Write fixups resolved against the exec symbols
+ * and the new entry point to the output file */
+void applyFixups(Context &ctx, FILE *exec, FILE *output,
+                 headerT &output_header, const vector<sectionT> &exec_sections,
+                 const LinkPlan &plan,
+                 unordered_map<int, uint64_t> &offset_map) {
+  vector<SymbolTable> exec_tables;
+  readSymbolTables(exec, exec_sections, exec_tables);
+
+  for (auto &f : plan.fixups) {
+    int64_t symbol_address;
+    if (f.target >= 0) {
+      symbol_address = offset_map[f.target] + ctx.base_address;
+    } else if (f.symbol == "orig_start") {
+      symbol_address = ctx.orig_start;
+    } else {
+      bool found = false;
+      for (auto &table : exec_tables) {
+        uint64_t value;
+        if (lookupSymbol(table, f.symbol, value)) {
+          found = true;
+          symbol_address = value;
+          break;
+        }
+      }
+      if (!found)
+        LOG_ERROR("Could not find symbol " + f.symbol);
+    }
+
+    int64_t instr_address = offset_map[f.section] + f.offset + ctx.base_address;
+    HANDLE_ERROR(fseek(output, instr_address - ctx.base_address, SEEK_SET),
+                 "applyFixups: fseek 1");
+    if (isAbsReference32(f.type)) {
+      int32_t address = symbol_address + f.addend;
+      HANDLE_ERROR(fwrite(&address, 1, sizeof(int32_t), output),
+                   "applyFixups: fwrite 1");
+    } else if (isAbsReference64(f.type)) {
+      int64_t address = symbol_address + f.addend;
+      HANDLE_ERROR(fwrite(&address, 1, sizeof(int64_t), output),
+                   "applyFixups: fwrite 2");
+    } else if (isPCReference(f.type)) {
+      int32_t address = symbol_address + f.addend - instr_address;
+      HANDLE_ERROR(fwrite(&address, 1, sizeof(int32_t), output),
+                   "applyFixups: fwrite 3");
+    }
+  }
+
+  // Save header
+  if (plan.entry_section >= 0) {
+    output_header.e_entry =
+        plan.entry_value + offset_map[plan.entry_section] + ctx.base_address;
+  }
+  HANDLE_ERROR(fseek(output, 0, SEEK_SET), "applyFixups: fseek 2");
   HANDLE_ERROR(fwrite(&output_header, 1, sizeof(output_header), output),
-               "applyRelocations: fwrite 4");
+               "applyFixups: fwrite 4");
   return;
 }
 
@@ -243,19 +537,15 @@ void saveSegmentContent(FILE *output, FILE *exec) {
 
 /* Save chosen sections (sections with ALLOC)
  * to the output file */
-void saveChosenSections(Context &ctx, FILE *output, FILE *rel,
-                        indexSecVecT &chosen_sections,
+void saveChosenSections(Context &ctx, FILE *output,
+                        indexSecVecT &chosen_sections, const LinkPlan &plan,
                         unordered_map<int, uint64_t> &offset_map) {
   for (auto &v : chosen_sections) {
     if (v.size()) {
       for (auto &p : v) {
-        vector<char> tmp(p.second.sh_size);
-        HANDLE_ERROR(fseek(rel, p.second.sh_offset, SEEK_SET),
-                     "saveChosenSections: fseek 1");
-        HANDLE_ERROR(fread((char *)tmp.data(), p.second.sh_size, 1, rel),
-                     "saveChosenSections: fread 1");
+        auto &tmp = plan.contents.at(p.first);
         HANDLE_ERROR(fseek(output, offset_map[p.first], SEEK_SET),
-                     "saveChosenSections: fseek 2");
+                     "saveChosenSections: fseek 1");
         p.second.sh_addr = ctx.base_address + ftell(output);
         p.second.sh_offset = ftell(output);
         HANDLE_ERROR(fwrite(tmp.data(), p.second.sh_size, sizeof(char), output),
@@ -266,16 +556,216 @@ void saveChosenSections(Context &ctx, FILE *output, FILE *rel,
   return;
 }
 
+/* Write table to the end of the output file
+ * aligned to <align>, return its offset */
+uint64_t appendTable(FILE *output, const void *data, uint64_t size,
+                     uint64_t align) {
+  HANDLE_ERROR(fseek(output, 0, SEEK_END), "appendTable: fseek");
+  uint64_t offset = ftell(output);
+  if (offset % align != 0) {
+    vector<char> padding(align - (offset % align));
+    HANDLE_ERROR(fwrite(padding.data(), 1, padding.size(), output),
+                 "appendTable: fwrite 1");
+    offset += padding.size();
+  }
+  HANDLE_ERROR(fwrite(data, 1, size, output), "appendTable: fwrite 2");
+  return offset;
+}
+
+uint32_t addString(vector<char> &strings, const string &s) {
+  uint32_t offset = strings.size();
+  strings.insert(strings.end(), s.begin(), s.end());
+  strings.push_back('\0');
+  return offset;
+}
+
+/* Shift symbol indices of relocations in the output file
+ * by <shift> for symbols at or after <first> */
+template <typename T>
+void remapRelocations(FILE *exec, FILE *output, const sectionT &exec_section,
+                      const sectionT &output_section, uint32_t first,
+                      uint32_t shift) {
+  vector<T> rels;
+  readSectionEntries(exec, exec_section, rels);
+  for (auto &r : rels) {
+    uint32_t sym = ELF64_R_SYM(r.r_info);
+    if (sym >= first) {
+      r.r_info = ELF64_R_INFO(sym + shift, ELF64_R_TYPE(r.r_info));
+    }
+  }
+  HANDLE_ERROR(fseek(output, output_section.sh_offset, SEEK_SET),
+               "remapRelocations: fseek");
+  HANDLE_ERROR(fwrite(rels.data(), sizeof(T), rels.size(), output),
+               "remapRelocations: fwrite");
+  return;
+}
+
+/* Add headers of the injected sections and symbols of the object
+ * to the exec .symtab, so the new code can be profiled and debugged.
+ * Injected locals are inserted after the exec locals and injected
+ * globals appended at the end, keeping their binding. Sections holding
+ * .symtab indices (relocations, groups, SHT_SYMTAB_SHNDX) are updated
+ * for the shifted exec globals. String and symbol tables are rewritten
+ * at the end of the output file */
+void saveSymbols(Context &ctx, FILE *output, headerT &output_header,
+                 vector<sectionT> &output_sections,
+                 const vector<sectionT> &exec_sections, FILE *exec,
+                 const LinkPlan &plan,
+                 unordered_map<int, uint64_t> &offset_map) {
+  int shstrndx = output_header.e_shstrndx;
+  if (output_sections.empty() || shstrndx == SHN_UNDEF ||
+      shstrndx >= int(exec_sections.size())) {
+    return;
+  }
+
+  vector<char> section_names, strings;
+  vector<symT> syms;
+  vector<uint32_t> shndx;
+  int symtab_index = -1, strtab_index = -1, shndx_index = -1;
+  uint32_t locals = 1;
+
+  readStrings(exec, exec_sections[shstrndx], section_names);
+  for (size_t i = 0; i < exec_sections.size(); ++i) {
+    if (exec_sections[i].sh_type == SHT_SYMTAB) {
+      symtab_index = i;
+      strtab_index = exec_sections[i].sh_link;
+      locals = exec_sections[i].sh_info;
+      readSectionEntries(exec, exec_sections[i], syms);
+      readStrings(exec, exec_sections[strtab_index], strings);
+    }
+  }
+  for (size_t i = 0; i < exec_sections.size(); ++i) {
+    if (exec_sections[i].sh_type == SHT_SYMTAB_SHNDX &&
+        int(exec_sections[i].sh_link) == symtab_index) {
+      shndx_index = i;
+      readSectionEntries(exec, exec_sections[i], shndx);
+    }
+  }
+  if (syms.empty()) {
+    syms.emplace_back(symT{});
+    strings = {'\0'};
+  }
+
+  // Injected sections
+  unordered_map<int, int> section_index;
+  for (auto &v : plan.sections) {
+    for (auto &p : v) {
+      sectionT s = p.second;
+      s.sh_name = addString(section_names, plan.section_names.at(p.first));
+      s.sh_addr = ctx.base_address + offset_map[p.first];
+      s.sh_offset = offset_map[p.first];
+      s.sh_link = 0;
+      s.sh_info = 0;
+      section_index[p.first] = output_sections.size();
+      output_sections.emplace_back(s);
+    }
+  }
+
+  // Stripped exec, create new .symtab and .strtab
+  if (symtab_index < 0) {
+    sectionT s = {};
+    s.sh_name = addString(section_names, ".strtab");
+    s.sh_type = SHT_STRTAB;
+    s.sh_addralign = 1;
+    strtab_index = output_sections.size();
+    output_sections.emplace_back(s);
+
+    s.sh_name = addString(section_names, ".symtab");
+    s.sh_type = SHT_SYMTAB;
+    s.sh_addralign = 8;
+    s.sh_entsize = sizeof(symT);
+    s.sh_link = strtab_index;
+    symtab_index = output_sections.size();
+    output_sections.emplace_back(s);
+  }
+  if (output_sections.size() >= SHN_LORESERVE) {
+    LOG_ERROR("Too many sections in the output");
+  }
+
+  vector<symT> new_locals;
+  for (auto &sym : plan.symbols) {
+    symT s = {};
+    s.st_name = addString(strings, sym.name);
+    s.st_info = sym.info;
+    s.st_other = sym.other;
+    s.st_shndx = section_index.at(sym.section);
+    s.st_value = ctx.base_address + offset_map[sym.section] + sym.value;
+    s.st_size = sym.size;
+    if (ELF64_ST_BIND(s.st_info) == STB_LOCAL) {
+      new_locals.emplace_back(s);
+    } else {
+      syms.emplace_back(s);
+    }
+  }
+  uint32_t shift = new_locals.size();
+  syms.insert(syms.begin() + locals, new_locals.begin(), new_locals.end());
+
+  // Exec globals moved by <shift>, update references to them
+  for (size_t i = 0; shift && i < exec_sections.size(); ++i) {
+    auto &s = exec_sections[i];
+    if (int(s.sh_link) != symtab_index) {
+      continue;
+    }
+    if (s.sh_type == SHT_RELA) {
+      remapRelocations<relaT>(exec, output, s, output_sections[i], locals,
+                              shift);
+    } else if (s.sh_type == SHT_REL) {
+      remapRelocations<relT>(exec, output, s, output_sections[i], locals,
+                             shift);
+    } else if (s.sh_type == SHT_GROUP && s.sh_info >= locals) {
+      output_sections[i].sh_info += shift;
+    }
+  }
+
+  auto &shstrtab = output_sections[shstrndx];
+  shstrtab.sh_offset = appendTable(output, section_names.data(),
+                                   section_names.size(), 1);
+  shstrtab.sh_size = section_names.size();
+
+  auto &strtab = output_sections[strtab_index];
+  strtab.sh_offset = appendTable(output, strings.data(), strings.size(), 1);
+  strtab.sh_size = strings.size();
+
+  auto &symtab = output_sections[symtab_index];
+  symtab.sh_offset =
+      appendTable(output, syms.data(), syms.size() * sizeof(symT), 8);
+  symtab.sh_size = syms.size() * sizeof(symT);
+  symtab.sh_info = locals + shift;
+
+  if (shndx_index >= 0) {
+    shndx.resize(std::max(shndx.size(), size_t(locals)), 0);
+    shndx.insert(shndx.begin() + locals, shift, 0);
+    shndx.resize(syms.size(), 0);
+    auto &symtab_shndx = output_sections[shndx_index];
+    symtab_shndx.sh_offset = appendTable(output, shndx.data(),
+                                         shndx.size() * sizeof(uint32_t), 4);
+    symtab_shndx.sh_size = shndx.size() * sizeof(uint32_t);
+  }
+  return;
+}
+
+/* Write section headers at the end of the output file */
+void saveSectionHeaders(FILE *output, headerT &output_header,
+                        const vector<sectionT> &output_sections) {
+  if (output_sections.empty()) {
+    return;
+  }
+  output_header.e_shoff =
+      appendTable(output, output_sections.data(),
+                  output_sections.size() * sizeof(sectionT), 8);
+  output_header.e_shnum = output_sections.size();
+  return;
+}
+
 /* Save headers and segments data to the output file */
 void saveOutput(Context &ctx, headerT &output_header,
                 const vector<segmentT> &output_segments,
                 const vector<segmentT> &exec_segments,
-                vector<sectionT> &rel_sections,
                 vector<sectionT> &output_sections,
                 const vector<sectionT> &exec_sections,
-                indexSecVecT &chosen_sections,
+                indexSecVecT &chosen_sections, const LinkPlan &plan,
                 unordered_map<int, uint64_t> &offset_map, FILE *output,
-                FILE *exec, FILE *rel) {
+                FILE *exec) {
 
   // Copy exec data into output file
   saveSegmentContent(output, exec);
@@ -288,57 +778,43 @@ void saveOutput(Context &ctx, headerT &output_header,
                  "saveOutput: fwrite 1");
   };
 
-  // Saving section headers
-  HANDLE_ERROR(fseek(output, output_header.e_shoff, SEEK_SET),
-               "saveOutput: fseek 2");
-
+  // Shift exec section offsets by the page added in front
   bool first = true;
   for (auto &s : output_sections) {
     if (!first)
       s.sh_offset += constants::kPageSize;
     else
       first = false;
-    HANDLE_ERROR(fwrite(&s, 1, sizeof(sectionT), output),
-                 "saveOutput: fwrite 2");
   };
 
   // Saving rel chosen sections content
-  saveChosenSections(ctx, output, rel, chosen_sections, offset_map);
+  saveChosenSections(ctx, output, chosen_sections, plan, offset_map);
+
+  // Saving symbols and section headers
+  saveSymbols(ctx, output, output_header, output_sections, exec_sections, exec,
+              plan, offset_map);
+  saveSectionHeaders(output, output_header, output_sections);
 
-  HANDLE_ERROR(fseek(output, 0, SEEK_SET), "applyRelocations: fseek 3");
+  HANDLE_ERROR(fseek(output, 0, SEEK_SET), "saveOutput: fseek 3");
   HANDLE_ERROR(fwrite(&output_header, 1, sizeof(output_header), output),
-               "applyRelocations: fwrite 3");
+               "saveOutput: fwrite 3");
   return;
 }
 
-/* Read all headers, find sections to move
- * create segments, create space, apply relocations */
-int runPostlinker(FILE *exec, FILE *rel, FILE *output) {
+/* Read all headers of the relocatable file, find sections to move,
+ * merge and lay them out, resolve relocations inside the object */
+void buildLinkPlan(FILE *rel, LinkPlan &plan) {
 
-  Context ctx;
-  headerT exec_header, rel_header, out_header;
-  vector<segmentT> exec_segments, output_segments;
-  vector<sectionT> exec_sections, rel_sections, output_sections;
+  /* Layout starts at offset 0, the exec only moves it as a whole */
+  Context ctx = {0, 0, 0};
+  headerT rel_header;
+  vector<sectionT> rel_sections;
   vector<pair<int, sectionT>> RSections, RWSections, RXSections, RWXSections;
+  vector<MergedSection> merged;
   unordered_map<int, uint64_t> offset_map;
 
-  /* ET_EXEC */
-  HANDLE_ERROR(fread((char *)&exec_header, sizeof exec_header, 1, exec),
-               "runPostlinker: fread 1");
-
-  readHeaders(exec, exec_header, exec_segments, exec_header.e_phnum,
-              exec_header.e_phoff);
-  readHeaders(exec, exec_header, exec_sections, exec_header.e_shnum,
-              exec_header.e_shoff);
-
-  findBaseAddress(ctx, exec_segments);
-  HANDLE_ERROR(fseek(exec, 0, SEEK_END), "runPostlinker: fseek 1");
-  ctx.file_end = ftell(exec);
-  ctx.orig_start = exec_header.e_entry;
-
-  /* ET_REL */
   HANDLE_ERROR(fread((char *)&rel_header, sizeof rel_header, 1, rel),
-               "runPostlinker: fread 2");
+               "buildLinkPlan: fread 1");
   readHeaders(rel, rel_header, rel_sections, rel_header.e_shnum,
               rel_header.e_shoff);
 
@@ -359,39 +835,242 @@ int runPostlinker(FILE *exec, FILE *rel, FILE *output) {
     ++section_id;
   }
 
+  /* Deduplicate SHF_MERGE sections */
+  mergeSections(rel, RSections, merged);
+  mergeSections(rel, RWSections, merged);
+  mergeSections(rel, RXSections, merged);
+  mergeSections(rel, RWXSections, merged);
+
+  layoutSections(ctx, RSections, offset_map);
+  layoutSections(ctx, RWSections, offset_map);
+  layoutSections(ctx, RXSections, offset_map);
+  layoutSections(ctx, RWXSections, offset_map);
+
+  plan.sections = {RSections, RWSections, RXSections, RWXSections};
+  for (auto &v : plan.sections) {
+    for (auto &p : v) {
+      vector<char> tmp(p.second.sh_size);
+      auto merged_section = findMergedSection(merged, p.first);
+      if (merged_section) {
+        tmp = merged_section->data;
+      } else if (p.second.sh_type != SHT_NOBITS) {
+        HANDLE_ERROR(fseek(rel, p.second.sh_offset, SEEK_SET),
+                     "buildLinkPlan: fseek 1");
+        HANDLE_ERROR(fread((char *)tmp.data(), p.second.sh_size, 1, rel),
+                     "buildLinkPlan: fread 2");
+      }
+      plan.contents[p.first] = tmp;
+    }
+  }
+
+  planRelocations(rel, rel_header, rel_sections, merged, offset_map, plan);
+  return;
+}
+
+/* Save link plan, so it can be applied
+ * to many execs without reading the object */
+void writeLinkPlan(FILE *output, const LinkPlan &plan) {
+  PlanHeader h = {};
+  std::copy(constants::kPlanMagic, constants::kPlanMagic + 8, h.magic);
+  h.version = constants::kPlanVersion;
+  for (int i = 0; i < 4; ++i) {
+    h.section_count[i] = plan.sections[i].size();
+  }
+  h.fixup_count = plan.fixups.size();
+  h.symbol_count = plan.symbols.size();
+  h.entry_section = plan.entry_section;
+  h.entry_value = plan.entry_value;
+  HANDLE_ERROR(fwrite(&h, 1, sizeof(h), output), "writeLinkPlan: fwrite 1");
+
+  for (auto &v : plan.sections) {
+    for (auto &p : v) {
+      int32_t index = p.first;
+      HANDLE_ERROR(fwrite(&index, 1, sizeof(index), output),
+                   "writeLinkPlan: fwrite 2");
+      HANDLE_ERROR(fwrite(&p.second, 1, sizeof(sectionT), output),
+                   "writeLinkPlan: fwrite 3");
+      auto &content = plan.contents.at(p.first);
+      HANDLE_ERROR(fwrite(content.data(), 1, content.size(), output),
+                   "writeLinkPlan: fwrite 4");
+      auto &name = plan.section_names.at(p.first);
+      uint32_t name_len = name.size();
+      HANDLE_ERROR(fwrite(&name_len, 1, sizeof(name_len), output),
+                   "writeLinkPlan: fwrite 5");
+      HANDLE_ERROR(fwrite(name.data(), 1, name.size(), output),
+                   "writeLinkPlan: fwrite 6");
+    }
+  }
+
+  for (auto &f : plan.fixups) {
+    PlanFixup pf = {f.section, f.target,   f.type, uint32_t(f.symbol.size()),
+                    f.offset,  f.addend};
+    HANDLE_ERROR(fwrite(&pf, 1, sizeof(pf), output),
+                 "writeLinkPlan: fwrite 7");
+    HANDLE_ERROR(fwrite(f.symbol.data(), 1, f.symbol.size(), output),
+                 "writeLinkPlan: fwrite 8");
+  }
+
+  for (auto &sym : plan.symbols) {
+    PlanSymbolEntry ps = {sym.section, sym.info, sym.other, 0,
+                          uint32_t(sym.name.size()), sym.value, sym.size};
+    HANDLE_ERROR(fwrite(&ps, 1, sizeof(ps), output),
+                 "writeLinkPlan: fwrite 9");
+    HANDLE_ERROR(fwrite(sym.name.data(), 1, sym.name.size(), output),
+                 "writeLinkPlan: fwrite 10");
+  }
+  return;
+}
+
+/* Read link plan saved by writeLinkPlan */
+void readLinkPlan(FILE *input, LinkPlan &plan) {
+  PlanHeader h;
+  HANDLE_ERROR(fseek(input, 0, SEEK_SET), "readLinkPlan: fseek");
+  if (fread(&h, sizeof(h), 1, input) != 1 ||
+      h.version != constants::kPlanVersion) {
+    LOG_ERROR("Unsupported link plan version");
+  }
+  plan.entry_section = h.entry_section;
+  plan.entry_value = h.entry_value;
+
+  plan.sections.resize(4);
+  for (int i = 0; i < 4; ++i) {
+    for (uint32_t j = 0; j < h.section_count[i]; ++j) {
+      int32_t index;
+      sectionT s;
+      if (fread(&index, sizeof(index), 1, input) != 1 ||
+          fread(&s, sizeof(s), 1, input) != 1) {
+        LOG_ERROR("readLinkPlan: truncated section");
+      }
+      vector<char> content(s.sh_size);
+      if (s.sh_size && fread(content.data(), s.sh_size, 1, input) != 1) {
+        LOG_ERROR("readLinkPlan: truncated section content");
+      }
+      uint32_t name_len;
+      if (fread(&name_len, sizeof(name_len), 1, input) != 1) {
+        LOG_ERROR("readLinkPlan: truncated section name");
+      }
+      string name(name_len, '\0');
+      if (name_len && fread(&name[0], name_len, 1, input) != 1) {
+        LOG_ERROR("readLinkPlan: truncated section name");
+      }
+      plan.sections[i].emplace_back(std::make_pair(index, s));
+      plan.contents[index] = content;
+      plan.section_names[index] = name;
+    }
+  }
+
+  for (uint32_t i = 0; i < h.fixup_count; ++i) {
+    PlanFixup pf;
+    if (fread(&pf, sizeof(pf), 1, input) != 1) {
+      LOG_ERROR("readLinkPlan: truncated fixup");
+    }
+    Fixup f;
+    f.section = pf.section;
+    f.target = pf.target;
+    f.type = pf.type;
+    f.offset = pf.offset;
+    f.addend = pf.addend;
+    f.symbol.resize(pf.symbol_len);
+    if (pf.symbol_len && fread(&f.symbol[0], pf.symbol_len, 1, input) != 1) {
+      LOG_ERROR("readLinkPlan: truncated fixup symbol");
+    }
+    plan.fixups.emplace_back(f);
+  }
+
+  for (uint32_t i = 0; i < h.symbol_count; ++i) {
+    PlanSymbolEntry ps;
+    if (fread(&ps, sizeof(ps), 1, input) != 1) {
+      LOG_ERROR("readLinkPlan: truncated symbol");
+    }
+    PlanSymbol sym;
+    sym.section = ps.section;
+    sym.info = ps.info;
+    sym.other = ps.other;
+    sym.value = ps.value;
+    sym.size = ps.size;
+    sym.name.resize(ps.name_len);
+    if (ps.name_len && fread(&sym.name[0], ps.name_len, 1, input) != 1) {
+      LOG_ERROR("readLinkPlan: truncated symbol name");
+    }
+    plan.symbols.emplace_back(sym);
+  }
+  return;
+}
+
+/* Check whether the file holds a link plan instead of ET_REL */
+bool isLinkPlan(FILE *fd) {
+  char magic[8] = {};
+  HANDLE_ERROR(fseek(fd, 0, SEEK_SET), "isLinkPlan: fseek 1");
+  auto r = fread(magic, 1, sizeof(magic), fd);
+  HANDLE_ERROR(fseek(fd, 0, SEEK_SET), "isLinkPlan: fseek 2");
+  return r == sizeof(magic) &&
+         std::equal(magic, magic + 8, constants::kPlanMagic);
+}
+
+/* Read all exec headers, create segments for the plan,
+ * create space, apply fixups */
+int runPostlinker(FILE *exec, LinkPlan &plan, FILE *output) {
+
+  Context ctx;
+  headerT exec_header, out_header;
+  vector<segmentT> exec_segments, output_segments;
+  vector<sectionT> exec_sections, output_sections;
+  unordered_map<int, uint64_t> offset_map;
+
+  /* ET_EXEC */
+  HANDLE_ERROR(fread((char *)&exec_header, sizeof exec_header, 1, exec),
+               "runPostlinker: fread 1");
+
+  readHeaders(exec, exec_header, exec_segments, exec_header.e_phnum,
+              exec_header.e_phoff);
+  readHeaders(exec, exec_header, exec_sections, exec_header.e_shnum,
+              exec_header.e_shoff);
+
+  findBaseAddress(ctx, exec_segments);
+  HANDLE_ERROR(fseek(exec, 0, SEEK_END), "runPostlinker: fseek 1");
+  ctx.file_end = ftell(exec);
+  /* New segments can't overlap memory of the exec
+   * segments, including .bss past the end of the file */
+  for (auto &p : exec_segments) {
+    if (p.p_type == PT_LOAD) {
+      ctx.file_end = std::max(ctx.file_end,
+                              int(p.p_vaddr + p.p_memsz - ctx.base_address));
+    }
+  }
+  ctx.orig_start = exec_header.e_entry;
+
   /* OUTPUT */
   out_header = exec_header;
   output_segments = exec_segments;
   output_sections = exec_sections;
 
   /* Start linking */
-  addNewSegment(ctx, out_header, output_segments, RSections, rel_sections,
-                offset_map, constants::kR);
-  addNewSegment(ctx, out_header, output_segments, RWSections, rel_sections,
-                offset_map, constants::kRW);
-  addNewSegment(ctx, out_header, output_segments, RXSections, rel_sections,
-                offset_map, constants::kRX);
-  addNewSegment(ctx, out_header, output_segments, RWXSections, rel_sections,
-                offset_map, constants::kRWX);
+  addNewSegment(ctx, out_header, output_segments, plan.sections[0], offset_map,
+                constants::kR);
+  addNewSegment(ctx, out_header, output_segments, plan.sections[1], offset_map,
+                constants::kRW);
+  addNewSegment(ctx, out_header, output_segments, plan.sections[2], offset_map,
+                constants::kRX);
+  addNewSegment(ctx, out_header, output_segments, plan.sections[3], offset_map,
+                constants::kRWX);
   makeSpaceForHeaders(ctx, out_header, output_segments, exec_segments,
                       offset_map);
 
-  indexSecVecT chosen_sections = {RSections, RWSections, RXSections,
-                                  RWXSections};
+  indexSecVecT chosen_sections = plan.sections;
 
-  saveOutput(ctx, out_header, output_segments, exec_segments, rel_sections,
-             output_sections, exec_sections, chosen_sections, offset_map,
-             output, exec, rel);
-  applyRelocations(ctx, rel, exec, output, out_header, rel_header, exec_header,
-                   exec_sections, rel_sections, output_sections,
-                   chosen_sections, offset_map);
+  saveOutput(ctx, out_header, output_segments, exec_segments, output_sections,
+             exec_sections, chosen_sections, plan, offset_map, output, exec);
+  applyFixups(ctx, exec, output, out_header, exec_sections, plan,
+              offset_map);
   return 0;
 }
 
 int main(int argc, char **argv) {
 
+  bool emit_plan = argc == 4 && string(argv[1]) == "--plan";
   if (argc != 4) {
-    std::cout << "Usage: ./poslinker <ET_EXEC> <ET_REL> <OUTPUT>\n";
+    std::cout << "Usage: ./poslinker <ET_EXEC> <ET_REL|PLAN> <OUTPUT>\n"
+              << "       ./poslinker --plan <ET_REL> <PLAN>\n";
     return 1;
   }
 
@@ -402,11 +1081,14 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  FILE *exec = fopen(argv[1], "rb");
-  if (!exec) {
-    LOG_ERROR(file_error + argv[1]);
-    closeFiles(rel);
-    return 1;
+  FILE *exec = nullptr;
+  if (!emit_plan) {
+    exec = fopen(argv[1], "rb");
+    if (!exec) {
+      LOG_ERROR(file_error + argv[1]);
+      closeFiles(rel);
+      return 1;
+    }
   }
 
   FILE *output = fopen(argv[3], "w+");
@@ -416,7 +1098,20 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  runPostlinker(exec, rel, output);
+  LinkPlan plan;
+  if (isLinkPlan(rel)) {
+    readLinkPlan(rel, plan);
+  } else {
+    buildLinkPlan(rel, plan);
+  }
+
+  if (emit_plan) {
+    writeLinkPlan(output, plan);
+    closeFiles(rel, output);
+    return 0;
+  }
+
+  runPostlinker(exec, plan, output);
   closeFiles(exec, rel, output);
   HANDLE_ERROR(chmod(argv[3], 0755), "main: chmod");
   return 0;
@@ -0,0 +1,6 @@
+#include <stdio.h>
+
+int main() {
+	printf("Main program [merge]\n");
+	return 0;
+}
@@ -0,0 +1,22 @@
+static const char msg[] = "hook A static\n";
+
+/* Local symbol with the same name as the exec function,
+ * must not be found when the next object is applied */
+__attribute__((used)) static void some_func() {
+	long ret;
+	__asm__ volatile("syscall"
+			 : "=a"(ret)
+			 : "a"(1), "D"(1), "S"(msg), "d"(sizeof msg - 1)
+			 : "rcx", "r11", "memory");
+}
+
+__asm__(
+	".global _start\n"
+	"_start:\n"
+	"push %rdx\n"
+	"push %rdx\n"
+	"call some_func\n"
+	"pop %rdx\n"
+	"pop %rdx\n"
+	"jmp orig_start\n"
+);
@@ -2,15 +2,36 @@
 make
 
 PROG=${PROG:=../postlinker}
-for tst in syscall syscall2 call noop rw ro def var static; do
+for tst in syscall syscall2 call noop rw ro def var static merge stripped; do
 	echo === Test $tst ===
 	${PROG} exec_${tst} rel_${tst}.o patched_${tst} 2>&1 > /dev/null
 	./patched_${tst} > tmp.out
 	cmp tmp.out ${tst}.out && echo "OK"
 done
 
+echo === Test merge sizes ===
+readelf -SW patched_merge > tmp.out
+grep -Eq "\.rodata\.str1\.1 +PROGBITS +[0-9a-f]+ [0-9a-f]+ 000017 " tmp.out &&
+	grep -Eq "\.rodata\.cst8 +PROGBITS +[0-9a-f]+ [0-9a-f]+ 000010 " tmp.out &&
+	echo OK
+
 echo === Test double call ===
 ${PROG} exec_call rel_call.o tmp 2>&1 > /dev/null
 ${PROG} tmp rel_call.o tmp2 2>&1 > /dev/null
 ./tmp2 > tmp.out
 cmp tmp.out call2.out && echo OK
+
+echo === Test plan ===
+${PROG} --plan rel_ro.o tmp.plan 2>&1 > /dev/null
+${PROG} exec_ro tmp.plan tmp 2>&1 > /dev/null
+./tmp > tmp.out
+cmp tmp.out ro.out && echo OK
+
+echo === Test symbols ===
+nm patched_ro | grep -q " T f$" && nm patched_ro | grep -q " D init$" && echo OK
+
+echo === Test local symbols ===
+${PROG} exec_call rel_local.o tmp 2>&1 > /dev/null
+${PROG} tmp rel_call.o tmp2 2>&1 > /dev/null
+./tmp2 > tmp.out
+cmp tmp.out local.out && echo OK
@@ -32,6 +32,8 @@ const int kRX = 0x5;
 const int kRW = 0x6;
 const int kRWX = 0x7;
 const int kPageSize = 0x1000;
+const char kPlanMagic[] = "PLNKPLAN";
+const uint32_t kPlanVersion = 2;
 
 } // namespace constants
 
@@ -41,6 +43,102 @@ typedef struct Context {
   int orig_start;
 } Context;
 
+/* Symbol table of the exec with its own string table.
+ * <hash> holds .gnu.hash or .hash words, <index> is built
+ * only for tables without a hash section */
+typedef struct SymbolTable {
+  vector<symT> syms;
+  vector<char> strings;
+  unsigned hash_type;
+  vector<uint32_t> hash;
+  unordered_map<string, uint64_t> index;
+} SymbolTable;
+
+/* Entry of a SHF_MERGE input section and
+ * its place in the merged output section */
+typedef struct MergePiece {
+  uint64_t in_off;
+  uint64_t out_off;
+} MergePiece;
+
+/* Deduplicated contents of SHF_MERGE sections of the same kind.
+ * <index> is the input section that stands for the whole group */
+typedef struct MergedSection {
+  int index;
+  sectionT header;
+  vector<char> data;
+  unordered_map<int, vector<MergePiece>> pieces;
+} MergedSection;
+
+/* Relocation resolved when the plan is applied to the exec:
+ * against undefined <symbol> if <target> is -1,
+ * otherwise against address of <target> section */
+typedef struct Fixup {
+  int section;
+  int target;
+  uint32_t type;
+  uint64_t offset;
+  int64_t addend;
+  string symbol;
+} Fixup;
+
+/* Symbol of the object emitted to the output .symtab,
+ * <value> is relative to <section> */
+typedef struct PlanSymbol {
+  int section;
+  unsigned char info;
+  unsigned char other;
+  uint64_t value;
+  uint64_t size;
+  string name;
+} PlanSymbol;
+
+/* Part of the linking that does not depend on the exec:
+ * classified sections with their contents (internal
+ * PC relative relocations already applied) and fixups */
+typedef struct LinkPlan {
+  indexSecVecT sections;
+  unordered_map<int, string> section_names;
+  unordered_map<int, vector<char>> contents;
+  vector<Fixup> fixups;
+  vector<PlanSymbol> symbols;
+  int entry_section;
+  uint64_t entry_value;
+} LinkPlan;
+
+/* On-disk link plan layout:
+ * header, for each section its index, header, content and name,
+ * for each fixup PlanFixup followed by the symbol name,
+ * for each symbol PlanSymbolEntry followed by its name */
+typedef struct PlanHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t section_count[4];
+  uint32_t fixup_count;
+  uint32_t symbol_count;
+  int32_t entry_section;
+  uint64_t entry_value;
+} PlanHeader;
+
+typedef struct PlanFixup {
+  int32_t section;
+  int32_t target;
+  uint32_t type;
+  uint32_t symbol_len;
+  uint64_t offset;
+  int64_t addend;
+} PlanFixup;
+
+typedef struct PlanSymbolEntry {
+  int32_t section;
+  unsigned char info;
+  unsigned char other;
+  uint16_t reserved;
+  uint32_t name_len;
+  uint64_t value;
+  uint64_t size;
+} PlanSymbolEntry;
+
 void LOG_ERROR(const std::string &msg) {
   std::cout << "ERROR: " << msg << ". Exiting\n";
   exit(1);
@@ -79,7 +177,7 @@ template <class... Args> void closeFiles(Args... args) {
   return;
 }
 
-string getName(unsigned index, vector<char> strings) {
+string getName(unsigned index, const vector<char> &strings) {
   std::string tmp = "";
   if (index < strings.size() && index >= 0) {
     char c = strings[index];
@@ -145,14 +243,13 @@ void readStrings(FILE *fd, const sectionT &s, vector<char> &strings) {
   return;
 }
 
-uint64_t extractSectionInfo(const indexSecVecT &sections,
-                            const vector<char> &section_names,
-                            unordered_map<int, uint64_t> &offset_map,
-                            const string &section_name) {
+int findSectionIndex(const indexSecVecT &sections,
+                     const vector<char> &section_names,
+                     const string &section_name) {
   for (auto &v : sections) {
     for (auto &new_s : v) {
       if (getName(new_s.second.sh_name, section_names) == section_name) {
-        return offset_map[new_s.first];
+        return new_s.first;
       }
     }
   }
@@ -160,17 +257,133 @@ uint64_t extractSectionInfo(const indexSecVecT &sections,
   return 0;
 }
 
-uint64_t getSectionOffset(const indexSecVecT &sections, int index) {
+const MergedSection *findMergedSection(const vector<MergedSection> &merged,
+                                       int index) {
+  for (auto &m : merged) {
+    if (m.pieces.count(index)) {
+      return &m;
+    }
+  }
+  return nullptr;
+}
+
+/* Translate offset inside SHF_MERGE input section
+ * to the offset inside merged output section */
+uint64_t translateMergeOffset(const vector<MergePiece> &pieces, int64_t off) {
+  auto it = std::upper_bound(
+      pieces.begin(), pieces.end(), off,
+      [](int64_t o, const MergePiece &p) { return o < int64_t(p.in_off); });
+  if (it == pieces.begin()) {
+    LOG_ERROR("Relocation points outside of merge section");
+  }
+  --it;
+  return it->out_off + (off - it->in_off);
+}
 
-  for (auto &v : sections) {
-    for (auto &p : v) {
-      if (p.first == index) {
-        return p.second.sh_offset;
-      }
+uint32_t gnuHash(const string &name) {
+  uint32_t h = 5381;
+  for (unsigned char c : name) {
+    h = h * 33 + c;
+  }
+  return h;
+}
+
+uint32_t sysvHash(const string &name) {
+  uint32_t h = 0, g;
+  for (unsigned char c : name) {
+    h = (h << 4) + c;
+    g = h & 0xf0000000;
+    if (g) {
+      h ^= g >> 24;
     }
+    h &= ~g;
   }
-  LOG_ERROR("Could not find section with id: " + index);
-  return 0;
+  return h;
+}
+
+bool definedSymbol(const symT &s) {
+  return s.st_shndx != SHN_UNDEF &&
+         correctSymbolType(ELF64_ST_TYPE(s.st_info)) &&
+         ELF64_ST_TYPE(s.st_info) != STT_SECTION;
+}
+
+/* Look the name up in .gnu.hash: bloom filter,
+ * bucket and the chain of hashes ending with odd value */
+bool lookupGnuHash(const SymbolTable &table, const string &name,
+                   uint64_t &value) {
+  auto &w = table.hash;
+  if (w.size() < 4) {
+    return false;
+  }
+  uint32_t nbuckets = w[0], symoffset = w[1], bloom_size = w[2],
+           bloom_shift = w[3];
+  uint64_t buckets = 4 + 2 * uint64_t(bloom_size);
+  uint64_t chains = buckets + nbuckets;
+  if (nbuckets == 0 || bloom_size == 0 || chains > w.size()) {
+    return false;
+  }
+
+  uint32_t h = gnuHash(name);
+  uint64_t k = 4 + 2 * ((h / 64) % bloom_size);
+  uint64_t word = w[k] | (uint64_t(w[k + 1]) << 32);
+  uint64_t mask = (uint64_t(1) << (h % 64)) |
+                  (uint64_t(1) << ((h >> bloom_shift) % 64));
+  if ((word & mask) != mask) {
+    return false;
+  }
+
+  uint32_t i = w[buckets + h % nbuckets];
+  if (i < symoffset) {
+    return false;
+  }
+  for (; i < table.syms.size() && chains + i - symoffset < w.size(); ++i) {
+    uint32_t h2 = w[chains + i - symoffset];
+    auto &s = table.syms[i];
+    if ((h | 1) == (h2 | 1) && definedSymbol(s) &&
+        getName(s.st_name, table.strings) == name) {
+      value = s.st_value;
+      return true;
+    }
+    if (h2 & 1) {
+      break;
+    }
+  }
+  return false;
+}
+
+/* Look the name up in SysV .hash buckets and chains */
+bool lookupSysvHash(const SymbolTable &table, const string &name,
+                    uint64_t &value) {
+  auto &w = table.hash;
+  if (w.size() < 2 || w[0] == 0 || 2 + uint64_t(w[0]) + w[1] > w.size()) {
+    return false;
+  }
+  uint32_t nbucket = w[0], nchain = w[1];
+  for (uint32_t i = w[2 + sysvHash(name) % nbucket];
+       i != STN_UNDEF && i < nchain && i < table.syms.size();
+       i = w[2 + nbucket + i]) {
+    auto &s = table.syms[i];
+    if (definedSymbol(s) && getName(s.st_name, table.strings) == name) {
+      value = s.st_value;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool lookupSymbol(const SymbolTable &table, const string &name,
+                  uint64_t &value) {
+  if (table.hash_type == SHT_GNU_HASH) {
+    return lookupGnuHash(table, name, value);
+  } else if (table.hash_type == SHT_HASH) {
+    return lookupSysvHash(table, name, value);
+  }
+  auto it = table.index.find(name);
+  if (it == table.index.end()) {
+    return false;
+  }
+  value = it->second;
+  return true;
 }
 
 void findBaseAddress(Context &ctx, const vector<segmentT> &segments) {